@@ -2,7 +2,7 @@
 /*******************************************************************************
  * sort/debug_helper.hpp
  *
- * Helper DEFINES for timing functions and sections.
+ * Helper DEFINES for timing functions and sections and debug messages.
  *   
  * Copyright (C) 2020 by Pit Henrich <pithenrich2d@gmail.com>
  *
@@ -45,10 +45,16 @@
   std::cout << "[CUSTOM TIMER] " << comment << int_ms_x0.count()/1000.0f << "s" << std::endl;\
   t1_x0 = std::chrono::high_resolution_clock::now();\
 }
+
+#define DEBUG_PRINT(message) \
+{\
+  std::cout << "[DEBUG] " << message << std::endl;\
+}
 #else
 #define TIME_FUNCTION(function, comment) function;
 #define TIME_START()
 #define TIME_RESET()
 #define TIME_PRINT(comment)
 #define TIME_PRINT_RESET(comment)
+#define DEBUG_PRINT(message)
 #endif
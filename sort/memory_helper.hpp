@@ -0,0 +1,162 @@
+/*******************************************************************************
+ * sort/memory_helper.hpp
+ *
+ * Helpers for allocating the scratch buffers of the sorts and for software
+ * prefetching.
+ *  allocate_buffer
+ *   Allocates an array of default constructed elements. If huge pages are
+ *   requested, we first try explicit huge pages (MAP_HUGETLB), then
+ *   transparent huge pages (madvise) and finally fall back to plain new[].
+ *  RDX_PREFETCH_READ / RDX_PREFETCH_WRITE
+ *   Prefetch hints, no-ops on compilers without __builtin_prefetch.
+ *
+ * Copyright (C) 2020 by Pit Henrich <pithenrich2d@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ * SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION
+ ******************************************************************************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <fstream>
+#include <string>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RDX_PREFETCH_READ(address) __builtin_prefetch((address), 0, 3)
+#define RDX_PREFETCH_WRITE(address) __builtin_prefetch((address), 1, 3)
+#else
+#define RDX_PREFETCH_READ(address)
+#define RDX_PREFETCH_WRITE(address)
+#endif
+
+namespace rdx {
+
+// Size of a (default) huge page on x86-64 and aarch64
+static constexpr const size_t huge_page_size = 2 * 1024 * 1024;
+
+// How a buffer from allocate_buffer ended up being backed
+enum class buffer_mode {
+  standard,
+  explicit_huge_pages,
+  transparent_huge_pages
+};
+
+static inline const char* buffer_mode_name(const buffer_mode mode) {
+  switch (mode) {
+    case buffer_mode::explicit_huge_pages:
+      return "explicit huge pages (MAP_HUGETLB)";
+    case buffer_mode::transparent_huge_pages:
+      return "transparent huge pages (madvise)";
+    default:
+      return "standard pages (new[])";
+  }
+}
+
+// Frees buffers from allocate_buffer; mapping_size == 0 means new[] was used.
+// Also remembers the buffer_mode, so callers can report what they measured.
+template <typename T>
+struct buffer_deleter {
+  void* mapping = nullptr;
+  size_t mapping_size = 0;
+  size_t element_count = 0;
+  buffer_mode mode = buffer_mode::standard;
+
+  void operator()(T* pointer) const {
+    if (mapping_size == 0) {
+      delete[] pointer;
+      return;
+    }
+    std::destroy_n(pointer, element_count);
+#if defined(__linux__)
+    munmap(mapping, mapping_size);
+#endif
+  }
+};
+
+template <typename T>
+using buffer_ptr = std::unique_ptr<T[], buffer_deleter<T>>;
+
+#if defined(__linux__)
+// madvise(MADV_HUGEPAGE) succeeds even if THP is set to never, so we have to
+// ask sysfs. The active setting is the one in brackets, "always [madvise] never"
+static inline bool transparent_huge_pages_enabled() {
+  std::ifstream file("/sys/kernel/mm/transparent_hugepage/enabled");
+  std::string setting;
+  std::getline(file, setting);
+  return setting.find("[always]") != std::string::npos ||
+         setting.find("[madvise]") != std::string::npos;
+}
+
+// Default constructs the elements in a fresh mapping; the mapping is released
+// if a constructor throws.
+template <typename T>
+static inline void construct_in_mapping(T* buffer, const size_t element_count,
+                                        void* mapping,
+                                        const size_t mapping_size) {
+  try {
+    std::uninitialized_default_construct_n(buffer, element_count);
+  } catch (...) {
+    munmap(mapping, mapping_size);
+    throw;
+  }
+}
+#endif
+
+template <typename T>
+static inline buffer_ptr<T> allocate_buffer(const size_t element_count,
+                                            const bool huge_pages) {
+#if defined(__linux__)
+  const size_t bytes = element_count * sizeof(T);
+  // Not worth it (or possible) for buffers smaller than one huge page
+  if (huge_pages && bytes >= huge_page_size) {
+    const size_t size = (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+
+    // Explicit huge pages, only works if the admin reserved some
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (mapping != MAP_FAILED) {
+      T* buffer = static_cast<T*>(mapping);
+      construct_in_mapping(buffer, element_count, mapping, size);
+      return buffer_ptr<T>(buffer, {mapping, size, element_count,
+                                    buffer_mode::explicit_huge_pages});
+    }
+
+    // Transparent huge pages, over allocate by one page so we can align the
+    // start; otherwise the first and last few MB are backed by small pages.
+    const size_t thp_size = size + huge_page_size;
+    mapping = mmap(nullptr, thp_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping != MAP_FAILED) {
+      const uintptr_t aligned =
+          (reinterpret_cast<uintptr_t>(mapping) + huge_page_size - 1) &
+          ~(huge_page_size - 1);
+      T* buffer = reinterpret_cast<T*>(aligned);
+      // Failure (kernel without THP) or THP set to never is fine, we just
+      // get small pages
+      const buffer_mode mode = madvise(buffer, size, MADV_HUGEPAGE) == 0 &&
+                                       transparent_huge_pages_enabled()
+                                   ? buffer_mode::transparent_huge_pages
+                                   : buffer_mode::standard;
+      construct_in_mapping(buffer, element_count, mapping, thp_size);
+      return buffer_ptr<T>(buffer, {mapping, thp_size, element_count, mode});
+    }
+  }
+#else
+  (void)huge_pages;
+#endif
+  return buffer_ptr<T>(new T[element_count], {});
+}
+
+}  // namespace rdx
@@ -15,6 +15,20 @@
  *   elements is limited; depending on the stack size your OS allocates for
  *   each thread. If you get funny segfaults, you probably didn't read this :P
  *
+ *   All three take an optional sort_config as last argument:
+ *    huge_pages
+ *     Back the scratch buffers (data cache, key cache) with huge pages, see
+ *     memory_helper.hpp. Reduces dTLB misses of the scatter on large inputs.
+ *    prefetch_distance
+ *     How many elements ahead the source elements and destination slots are
+ *     prefetched in the histogram and scatter loops; 0 disables prefetching.
+ *    detect_presorted (radix_sort_prefix_par only)
+ *     Check for presorted input while building the first key cache. Sorted
+ *     input returns right away, strictly reverse sorted input is reversed and
+ *     input made of a few sorted runs is merged instead of radix sorted.
+ *     Keys are compared the way the radix passes order them, i.e. as unsigned
+ *     integers of the same size; other key sizes skip the check.
+ *
  *   I suggest you look at the tests to see how to use these functions.
  *
  * Copyright (C) 2020 by Pit Henrich <pithenrich2d@gmail.com>
@@ -46,13 +60,99 @@
 #include <omp.h>
 
 #include "debug_helper.hpp"
+#include "memory_helper.hpp"
 
 namespace rdx {
 
+struct sort_config {
+  bool huge_pages = false;
+  size_t prefetch_distance = 0;
+  bool detect_presorted = true;
+};
+
+// Upper bound on the number of sorted runs we merge instead of radix sorting
+static constexpr const size_t presorted_max_runs = 16;
+
+// Unsigned integer with the same order as the LSD byte passes, void if there
+// is none for the key size.
+template <size_t size_of_key>
+struct radix_order_type {
+  typedef void type;
+};
+template <>
+struct radix_order_type<1> {
+  typedef uint8_t type;
+};
+template <>
+struct radix_order_type<2> {
+  typedef uint16_t type;
+};
+template <>
+struct radix_order_type<4> {
+  typedef uint32_t type;
+};
+template <>
+struct radix_order_type<8> {
+  typedef uint64_t type;
+};
+
+template <typename Key>
+static inline auto radix_order(const Key& key) {
+  typename radix_order_type<sizeof(Key)>::type order;
+  std::memcpy(&order, &key, sizeof(Key));
+  return order;
+}
+
+// Stable parallel merge of [a, a + a_count) and [b, b + b_count) into out.
+// Each thread takes an equal share of the output and finds its inputs with a
+// binary search along the merge path.
+template <typename T, typename Compare>
+static inline void parallel_merge(T* a, const size_t a_count, T* b,
+                                  const size_t b_count, T* out,
+                                  const Compare comp) {
+  const size_t total = a_count + b_count;
+  // Number of elements taken from a for the first diagonal elements of out
+  auto co_rank = [=](const size_t diagonal) {
+    size_t low = diagonal > b_count ? diagonal - b_count : 0;
+    size_t high = std::min(diagonal, a_count);
+    while (low < high) {
+      const size_t mid = (low + high) / 2;
+      // Ties go to a, this keeps the merge stable
+      if (!comp(b[diagonal - mid - 1], a[mid])) {
+        low = mid + 1;
+      } else {
+        high = mid;
+      }
+    }
+    return low;
+  };
+
+  const size_t thread_count = omp_get_max_threads();
+#pragma omp parallel for schedule(static)
+  for (size_t thread = 0; thread < thread_count; ++thread) {
+    const size_t out_begin = total * thread / thread_count;
+    const size_t out_end = total * (thread + 1) / thread_count;
+    const size_t a_begin = co_rank(out_begin);
+    const size_t a_end = co_rank(out_end);
+    std::merge(std::make_move_iterator(a + a_begin),
+               std::make_move_iterator(a + a_end),
+               std::make_move_iterator(b + out_begin - a_begin),
+               std::make_move_iterator(b + out_end - a_end), out + out_begin,
+               comp);
+  }
+}
+
+// Loop indices below the limit may prefetch index + distance
+static inline size_t prefetch_limit(const size_t element_count,
+                                    const size_t distance) {
+  return (distance == 0 || distance >= element_count) ? 0
+                                                      : element_count - distance;
+}
+
 template <typename Iterator, typename KeyGetter>
-static inline void radix_sort_prefix_par(const Iterator begin,
-                                         const Iterator end,
-                                         const KeyGetter key_getter) {
+static inline void radix_sort_prefix_par(
+    const Iterator begin, const Iterator end, const KeyGetter key_getter,
+    const sort_config config = sort_config{}) {
   TIME_START();
 
   // Setup
@@ -63,10 +163,12 @@ static inline void radix_sort_prefix_par(const Iterator begin,
 
   // The key cache contains the key value for the current radix
   // iteration
-  std::unique_ptr<uint8_t[]> key_cache(new uint8_t[element_count]);
+  buffer_ptr<uint8_t> key_cache =
+      allocate_buffer<uint8_t>(element_count, config.huge_pages);
   // Data cache, a buffer which will be used to write the result of a
   // radix step into. Notice, impl. is out of place.
-  std::unique_ptr<data_type[]> data_cache(new data_type[element_count]);
+  buffer_ptr<data_type> data_cache =
+      allocate_buffer<data_type>(element_count, config.huge_pages);
 
   // We use pointers internally; we don't have concepts yet...
   data_type* begin_original = &*begin;
@@ -74,21 +176,170 @@ static inline void radix_sort_prefix_par(const Iterator begin,
   data_type* begin_cache = data_cache.get();
   data_type* end_cache = &(data_cache[element_count - 1]);
 
+  const size_t distance = config.prefetch_distance;
+  const size_t prefetch_end = prefetch_limit(element_count, distance);
+
+  DEBUG_PRINT("Key cache: "
+              << buffer_mode_name(key_cache.get_deleter().mode));
+  DEBUG_PRINT("Data cache: "
+              << buffer_mode_name(data_cache.get_deleter().mode));
   TIME_PRINT_RESET("Setup time");
 
   // 2D array holding the bucket sizes for each thread
   std::vector<std::array<size_t, 256>> bucket_sizes(thread_count, {0});
 
+  typedef std::decay_t<decltype(key_getter(*begin))> key_type;
+  constexpr const bool can_detect_presorted =
+      !std::is_void<typename radix_order_type<size_of_key>::type>::value;
+  const bool detect_presorted = can_detect_presorted && config.detect_presorted;
+
+  auto parallel_move = [=](data_type* from, const size_t count, data_type* to) {
+#pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < count; ++i) {
+      to[i] = std::move(from[i]);
+    }
+  };
+
   // Start of actual work//////////////////
   for (size_t depth = 0; depth < size_of_key; ++depth) {
+    if constexpr (can_detect_presorted) {
+      if (depth == 0 && detect_presorted) {
+        // Per thread number of descents (key[i - 1] > key[i]) and
+        // non-descents, plus the first positions of the descents (run starts)
+        std::vector<size_t> descents(thread_count, 0);
+        std::vector<size_t> non_descents(thread_count, 0);
+        std::vector<std::vector<size_t>> run_starts(thread_count);
+
+// create the key cache, fused with the presortedness check
+// static schedule, so the threads' chunks are contiguous and in order
+#pragma omp parallel
+        {
+          size_t private_descents = 0;
+          size_t private_non_descents = 0;
+          std::vector<size_t> private_run_starts;
+          bool first = true;
+          // Overwritten in the first iteration; no default constructed key_type
+          typename radix_order_type<size_of_key>::type previous = 0;
+#pragma omp for schedule(static)
+          for (size_t i = 0; i < element_count; ++i) {
+            if (i < prefetch_end) {
+              RDX_PREFETCH_READ(begin_original + i + distance);
+            }
+            const key_type key = key_getter(*(begin_original + i));
+            key_cache[i] = reinterpret_cast<const uint8_t*>(&key)[0];
+            const auto current = radix_order(key);
+            // The only extra key read, at the start of each thread's chunk
+            if (first) {
+              first = false;
+              previous = i == 0 ? current
+                                : radix_order(key_getter(begin_original[i - 1]));
+              if (i == 0) {
+                continue;
+              }
+            }
+            // Branchless counting, on random keys a branch here would be
+            // mispredicted half of the time.
+            const bool descent = current < previous;
+            private_descents += descent;
+            private_non_descents += !descent;
+            if (descent && private_descents <= presorted_max_runs) {
+              private_run_starts.push_back(i);
+            }
+            previous = current;
+          }
+          const size_t thread = omp_get_thread_num();
+          descents[thread] = private_descents;
+          non_descents[thread] = private_non_descents;
+          run_starts[thread] = std::move(private_run_starts);
+        }
+        TIME_PRINT_RESET("Create Cache and detect presorted");
+
+        size_t descent_count = 0;
+        size_t non_descent_count = 0;
+        for (size_t thread = 0; thread < thread_count; ++thread) {
+          descent_count += descents[thread];
+          non_descent_count += non_descents[thread];
+        }
+
+        // Already sorted
+        if (descent_count == 0) {
+          return;
+        }
+
+        // Strictly reverse sorted, reversing keeps the sort stable
+        if (non_descent_count == 0) {
+#pragma omp parallel for schedule(static)
+          for (size_t i = 0; i < element_count / 2; ++i) {
+            std::swap(begin_original[i], begin_original[element_count - 1 - i]);
+          }
+          TIME_PRINT_RESET("Reverse presorted");
+          return;
+        }
+
+        // A few sorted runs; merging them takes ceil(log2(runs)) moves of
+        // every element, plus one to copy back if that number is odd. Only do
+        // it if that beats one move per key byte; the partial copies of odd
+        // runs out and the key_getter calls per comparison are not counted,
+        // hence strictly fewer.
+        const size_t run_count = descent_count + 1;
+        size_t merge_rounds = 0;
+        while ((size_t{1} << merge_rounds) < run_count) {
+          ++merge_rounds;
+        }
+        const size_t merge_moves = merge_rounds + (merge_rounds & 1);
+        if (run_count <= presorted_max_runs && merge_moves < size_of_key) {
+          std::vector<size_t> runs{0};
+          for (const auto& thread_run_starts : run_starts) {
+            runs.insert(runs.end(), thread_run_starts.begin(),
+                        thread_run_starts.end());
+          }
+          runs.push_back(element_count);
+
+          auto comp = [&](const data_type& a, const data_type& b) {
+            return radix_order(key_getter(a)) < radix_order(key_getter(b));
+          };
+          while (runs.size() > 2) {
+            std::vector<size_t> merged_runs;
+            for (size_t run = 0; run + 1 < runs.size(); run += 2) {
+              merged_runs.push_back(runs[run]);
+              if (run + 2 < runs.size()) {
+                parallel_merge(begin_original + runs[run],
+                               runs[run + 1] - runs[run],
+                               begin_original + runs[run + 1],
+                               runs[run + 2] - runs[run + 1],
+                               begin_cache + runs[run], comp);
+              } else {
+                // Odd run out, just carry it over
+                parallel_move(begin_original + runs[run],
+                              runs[run + 1] - runs[run],
+                              begin_cache + runs[run]);
+              }
+            }
+            merged_runs.push_back(element_count);
+            runs = std::move(merged_runs);
+            std::swap(begin_original, begin_cache);
+          }
+          if (begin_original != &*begin) {
+            parallel_move(begin_original, element_count, begin_cache);
+          }
+          TIME_PRINT_RESET("Merge presorted runs");
+          return;
+        }
+      }
+    }
+    if (depth != 0 || !detect_presorted) {
 // create the key cache
 // static schedule to minimise false sharing
 #pragma omp parallel for schedule(static)
-    for (size_t i = 0; i < element_count; ++i) {
-      auto key = key_getter(*(begin_original + i));
-      key_cache[i] = reinterpret_cast<uint8_t*>(&key)[depth];
+      for (size_t i = 0; i < element_count; ++i) {
+        if (i < prefetch_end) {
+          RDX_PREFETCH_READ(begin_original + i + distance);
+        }
+        auto key = key_getter(*(begin_original + i));
+        key_cache[i] = reinterpret_cast<uint8_t*>(&key)[depth];
+      }
+      TIME_PRINT_RESET("Create Cache");
     }
-    TIME_PRINT_RESET("Create Cache");
 
 // eval. the bucket sizes for each thread
 #pragma omp parallel
@@ -128,6 +379,10 @@ static inline void radix_sort_prefix_par(const Iterator begin,
       std::array<data_type*, 256> bucket_local = buckets[omp_get_thread_num()];
 #pragma omp for schedule(static)
       for (size_t i = 0; i < element_count; ++i) {
+        if (i < prefetch_end) {
+          RDX_PREFETCH_READ(begin_original + i + distance);
+          RDX_PREFETCH_WRITE(bucket_local[key_cache[i + distance]]);
+        }
         *(bucket_local[key_cache[i]]++) = std::move(*(begin_original + i));
       }
     }
@@ -147,9 +402,9 @@ static inline void radix_sort_prefix_par(const Iterator begin,
 }
 
 template <typename Iterator, typename KeyGetter>
-static inline void radix_sort_prefix_par_no_cache(const Iterator begin,
-                                                  const Iterator end,
-                                                  const KeyGetter key_getter) {
+static inline void radix_sort_prefix_par_no_cache(
+    const Iterator begin, const Iterator end, const KeyGetter key_getter,
+    const sort_config config = sort_config{}) {
   TIME_START();
 
   // Setup
@@ -163,7 +418,8 @@ static inline void radix_sort_prefix_par_no_cache(const Iterator begin,
   // std::unique_ptr<uint8_t[]> key_cache(new uint8_t[element_count]);
   // Data cache, a buffer which will be used to write the result of a
   // radix step into. Notice, impl. is out of place.
-  std::unique_ptr<data_type[]> data_cache(new data_type[element_count]);
+  buffer_ptr<data_type> data_cache =
+      allocate_buffer<data_type>(element_count, config.huge_pages);
 
   // We use pointers internally; we don't have concepts yet...
   data_type* begin_original = &*begin;
@@ -171,6 +427,12 @@ static inline void radix_sort_prefix_par_no_cache(const Iterator begin,
   data_type* begin_cache = data_cache.get();
   data_type* end_cache = &(data_cache[element_count - 1]);
 
+  const size_t distance = config.prefetch_distance;
+  const size_t prefetch_end = prefetch_limit(element_count, distance);
+  const size_t prefetch_end_2x = prefetch_limit(element_count, 2 * distance);
+
+  DEBUG_PRINT("Data cache: "
+              << buffer_mode_name(data_cache.get_deleter().mode));
   TIME_PRINT_RESET("Setup time");
 
   // 2D array holding the bucket sizes for each thread
@@ -192,6 +454,9 @@ static inline void radix_sort_prefix_par_no_cache(const Iterator begin,
       std::array<size_t, 256> private_bucket_size{0};  // Init to 0
 #pragma omp for schedule(static)
       for (size_t i = 0; i < element_count; ++i) {
+        if (i < prefetch_end) {
+          RDX_PREFETCH_READ(begin_original + i + distance);
+        }
         ++private_bucket_size[get_depth_key(i)];
       }
 
@@ -224,6 +489,14 @@ static inline void radix_sort_prefix_par_no_cache(const Iterator begin,
       std::array<data_type*, 256> bucket_local = buckets[omp_get_thread_num()];
 #pragma omp for schedule(static)
       for (size_t i = 0; i < element_count; ++i) {
+        // The source is fetched twice as far ahead, so the key lookup for
+        // the destination prefetch does not stall on it.
+        if (i < prefetch_end_2x) {
+          RDX_PREFETCH_READ(begin_original + i + 2 * distance);
+        }
+        if (i < prefetch_end) {
+          RDX_PREFETCH_WRITE(bucket_local[get_depth_key(i + distance)]);
+        }
         *(bucket_local[get_depth_key(i)]++) = std::move(*(begin_original + i));
       }
     }
@@ -244,7 +517,8 @@ static inline void radix_sort_prefix_par_no_cache(const Iterator begin,
 
 template <typename Iterator, typename KeyGetter>
 static inline void radix_sort_prefix_par_no_cache_write_back_buffer(
-    const Iterator begin, const Iterator end, const KeyGetter key_getter) {
+    const Iterator begin, const Iterator end, const KeyGetter key_getter,
+    const sort_config config = sort_config{}) {
   TIME_START();
 
   // Setup
@@ -261,7 +535,8 @@ static inline void radix_sort_prefix_par_no_cache_write_back_buffer(
   // std::unique_ptr<uint8_t[]> key_cache(new uint8_t[element_count]);
   // Data cache, a buffer which will be used to write the result of a
   // radix step into. Notice, impl. is out of place.
-  std::unique_ptr<data_type[]> data_cache(new data_type[element_count]);
+  buffer_ptr<data_type> data_cache =
+      allocate_buffer<data_type>(element_count, config.huge_pages);
 
   // We use pointers internally; we don't have concepts yet...
   data_type* begin_original = &*begin;
@@ -269,6 +544,11 @@ static inline void radix_sort_prefix_par_no_cache_write_back_buffer(
   data_type* begin_cache = data_cache.get();
   data_type* end_cache = &(data_cache[element_count - 1]);
 
+  const size_t distance = config.prefetch_distance;
+  const size_t prefetch_end = prefetch_limit(element_count, distance);
+
+  DEBUG_PRINT("Data cache: "
+              << buffer_mode_name(data_cache.get_deleter().mode));
   TIME_PRINT_RESET("Setup time");
 
   // 2D array holding the bucket sizes for each thread
@@ -290,6 +570,9 @@ static inline void radix_sort_prefix_par_no_cache_write_back_buffer(
       std::array<size_t, 256> private_bucket_size{0};  // Init to 0
 #pragma omp for schedule(static)
       for (size_t i = 0; i < element_count; ++i) {
+        if (i < prefetch_end) {
+          RDX_PREFETCH_READ(begin_original + i + distance);
+        }
         ++private_bucket_size[get_depth_key(i)];
       }
 
@@ -326,6 +609,10 @@ static inline void radix_sort_prefix_par_no_cache_write_back_buffer(
 
 #pragma omp for schedule(static)
       for (size_t i = 0; i < element_count; ++i) {
+        // Destinations are the thread local buffers, these are hot anyway
+        if (i < prefetch_end) {
+          RDX_PREFETCH_READ(begin_original + i + distance);
+        }
         const auto k = get_depth_key(i);
         local_cache[k][local_cache_size[k]] = std::move(*(begin_original + i));
         local_cache_size[k]++;
@@ -2,6 +2,7 @@
 #include <debug_helper.hpp>
 #include <iomanip>
 #include <radix_sort_prefix.hpp>
+#include <string>
 #include <vector>
 #include "control.hpp"
 #if 0
@@ -67,6 +68,71 @@ int main() {
   sorted &= std::is_sorted(values2.begin(), values2.end());
   values2 = values;
 
+  rdx::sort_config huge_pages;
+  huge_pages.huge_pages = true;
+  rdx::sort_config prefetch;
+  prefetch.prefetch_distance = 16;
+  rdx::sort_config huge_pages_prefetch = huge_pages;
+  huge_pages_prefetch.prefetch_distance = 16;
+
+  for (const auto& [config, name] :
+       {std::make_pair(huge_pages, " (huge pages)"),
+        std::make_pair(prefetch, " (prefetch)"),
+        std::make_pair(huge_pages_prefetch, " (huge pages + prefetch)")}) {
+    TIME_FUNCTION(rdx::radix_sort_prefix_par(values2.begin(), values2.end(),
+                                             getter, config);
+                  , std::string(" par. prefix byte time") + name);
+    sorted &= std::is_sorted(values2.begin(), values2.end());
+    values2 = values;
+
+    TIME_FUNCTION(rdx::radix_sort_prefix_par_no_cache(
+                      values2.begin(), values2.end(), getter, config);
+                  , std::string(" par. prefix no cache time") + name);
+    sorted &= std::is_sorted(values2.begin(), values2.end());
+    values2 = values;
+
+    TIME_FUNCTION(rdx::radix_sort_prefix_par_no_cache_write_back_buffer(
+                      values2.begin(), values2.end(), getter, config);
+                  , std::string(" par. prefix no cache write back cache time") +
+                        name);
+    sorted &= std::is_sorted(values2.begin(), values2.end());
+    values2 = values;
+  }
+
+  // Cost of the presortedness check on random input
+  rdx::sort_config no_detect;
+  no_detect.detect_presorted = false;
+  TIME_FUNCTION(rdx::radix_sort_prefix_par(values2.begin(), values2.end(),
+                                           getter, no_detect);
+                , " par. prefix byte time (no presorted detection)");
+  sorted &= std::is_sorted(values2.begin(), values2.end());
+  values2 = values;
+
+  TIME_FUNCTION(
+      rdx::radix_sort_prefix_par(values2.begin(), values2.end(), getter);
+      , " par. prefix byte time (presorted detection)");
+  sorted &= std::is_sorted(values2.begin(), values2.end());
+  values2 = values;
+
+  // Presorted input; sorted, then two sorted halves
+  std::vector<uint32_t> presorted = values;
+  std::sort(presorted.begin(), presorted.end());
+  values2 = presorted;
+  TIME_FUNCTION(
+      rdx::radix_sort_prefix_par(values2.begin(), values2.end(), getter);
+      , " par. prefix byte time (sorted input)");
+  sorted &= std::is_sorted(values2.begin(), values2.end());
+
+  presorted = values;
+  std::sort(presorted.begin(), presorted.begin() + value_count / 2);
+  std::sort(presorted.begin() + value_count / 2, presorted.end());
+  values2 = presorted;
+  TIME_FUNCTION(
+      rdx::radix_sort_prefix_par(values2.begin(), values2.end(), getter);
+      , " par. prefix byte time (two sorted runs)");
+  sorted &= std::is_sorted(values2.begin(), values2.end());
+  values2 = values;
+
   //  rdx::radix_sort(elements_pair.begin(), elements_pair.end(), comp_pair);
 
   if (sorted) {
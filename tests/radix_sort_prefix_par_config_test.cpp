@@ -0,0 +1,47 @@
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <radix_sort_prefix.hpp>
+#include <vector>
+#include "control.hpp"
+
+int main() {
+  std::vector<uint32_t> values(value_count);
+  std::generate(values.begin(), values.end(), std::rand);
+  std::vector<uint32_t> sorted_values = values;
+  std::sort(sorted_values.begin(), sorted_values.end());
+
+  auto getter = [](const uint32_t& val) { return val; };
+  bool sorted = true;
+
+  for (const bool huge_pages : {false, true}) {
+    for (const size_t distance : {0u, 1u, 16u, 2 * value_count}) {
+      rdx::sort_config config;
+      config.huge_pages = huge_pages;
+      config.prefetch_distance = distance;
+
+      std::vector<uint32_t> copy = values;
+      rdx::radix_sort_prefix_par(copy.begin(), copy.end(), getter, config);
+      sorted &= (copy == sorted_values);
+
+      copy = values;
+      rdx::radix_sort_prefix_par_no_cache(copy.begin(), copy.end(), getter,
+                                          config);
+      sorted &= (copy == sorted_values);
+
+      copy = values;
+      rdx::radix_sort_prefix_par_no_cache_write_back_buffer(
+          copy.begin(), copy.end(), getter, config);
+      sorted &= (copy == sorted_values);
+    }
+  }
+
+  if (sorted) {
+    std::cout << "[SUCCESS] Sorting with huge pages and prefetching.\n";
+  } else {
+    std::cout << "[FAILED] Sorting with huge pages and prefetching.\n";
+    return 1;
+  }
+
+  return 0;
+}
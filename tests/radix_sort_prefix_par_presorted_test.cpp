@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <array>
+#include <iostream>
+#include <radix_sort_prefix.hpp>
+#include <string>
+#include <vector>
+#include "control.hpp"
+
+struct key_index_pair {
+  uint32_t key;
+  uint32_t index;
+};
+
+// Sorts a copy with and without presortedness detection, both must match the
+// stable sort by key.
+static bool check(const std::vector<key_index_pair>& input,
+                  const std::string& name) {
+  auto getter = [](const key_index_pair& a) { return a.key; };
+  auto comp = [](const key_index_pair& a, const key_index_pair& b) {
+    return a.key < b.key;
+  };
+  auto equal = [](const key_index_pair& a, const key_index_pair& b) {
+    return a.key == b.key && a.index == b.index;
+  };
+
+  std::vector<key_index_pair> expected = input;
+  std::stable_sort(expected.begin(), expected.end(), comp);
+
+  bool sorted = true;
+  for (const bool detect : {true, false}) {
+    rdx::sort_config config;
+    config.detect_presorted = detect;
+    std::vector<key_index_pair> values = input;
+    rdx::radix_sort_prefix_par(values.begin(), values.end(), getter, config);
+    sorted &= std::equal(values.begin(), values.end(), expected.begin(),
+                         equal);
+  }
+  if (!sorted) {
+    std::cout << "[FAILED] Sorting presorted input: " << name << ".\n";
+  }
+  return sorted;
+}
+
+int main() {
+  std::vector<key_index_pair> values(value_count);
+  for (uint32_t i = 0; i < value_count; ++i) {
+    values[i] = {static_cast<uint32_t>(std::rand()), i};
+  }
+  auto by_key = [](const key_index_pair& a, const key_index_pair& b) {
+    return a.key < b.key;
+  };
+  auto renumber = [](std::vector<key_index_pair>& v) {
+    for (uint32_t i = 0; i < v.size(); ++i) {
+      v[i].index = i;
+    }
+  };
+
+  bool sorted = true;
+  sorted &= check(values, "random");
+
+  std::vector<key_index_pair> input = values;
+  std::sort(input.begin(), input.end(), by_key);
+  renumber(input);
+  sorted &= check(input, "sorted");
+
+  // Strictly reverse sorted, random keys may contain duplicates
+  for (uint32_t i = 0; i < value_count; ++i) {
+    input[i] = {(value_count - i) * 2048, i};
+  }
+  sorted &= check(input, "reverse sorted");
+
+  // Reverse sorted with ties must not simply be reversed (stability)
+  for (auto& element : input) {
+    element.key /= 4096;
+  }
+  sorted &= check(input, "reverse sorted with ties");
+
+  // Sorted runs of different lengths, with ties across runs
+  for (const size_t run_count : {2, 3, 5, 8, 16, 17}) {
+    std::vector<key_index_pair> runs = values;
+    for (auto& element : runs) {
+      element.key %= value_count / 2;
+    }
+    for (size_t run = 0; run < run_count; ++run) {
+      const size_t run_begin = value_count * run * run / (run_count * run_count);
+      const size_t run_end =
+          value_count * (run + 1) * (run + 1) / (run_count * run_count);
+      std::sort(runs.begin() + run_begin, runs.begin() + run_end, by_key);
+    }
+    renumber(runs);
+    sorted &= check(runs, std::to_string(run_count) + " sorted runs");
+  }
+
+  // Signed keys are ordered like the radix passes order them (as unsigned)
+  std::vector<int32_t> signed_values(value_count);
+  for (uint32_t i = 0; i < value_count; ++i) {
+    signed_values[i] = static_cast<int32_t>(i) - value_count / 2;
+  }
+  std::vector<int32_t> signed_expected = signed_values;
+  auto signed_getter = [](const int32_t& val) { return val; };
+  rdx::sort_config no_detect;
+  no_detect.detect_presorted = false;
+  rdx::radix_sort_prefix_par(signed_expected.begin(), signed_expected.end(),
+                             signed_getter, no_detect);
+  rdx::radix_sort_prefix_par(signed_values.begin(), signed_values.end(),
+                             signed_getter);
+  if (signed_values != signed_expected) {
+    std::cout << "[FAILED] Sorting presorted input: signed keys.\n";
+    sorted = false;
+  }
+
+  if (sorted) {
+    std::cout << "[SUCCESS] Sorting presorted input.\n";
+  } else {
+    return 1;
+  }
+
+  return 0;
+}